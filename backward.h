@@ -3,15 +3,51 @@
 #include "node.h"
 #include <algorithm>
 #include <cmath>
+#include <functional>
 #include <iostream>
 #include <ostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
-static void backward(std::vector<int>&order){
+// Number of edges from consumers in order into each node (x*x counts x twice).
+static std::unordered_map<int,int> countConsumers(const std::vector<int>&order){
+    std::unordered_map<int,int> pending;
+    for(auto n : order){
+        auto node = Node::GetNode(n);
+        if (!node) {continue;}
+        for (auto pid : node->GetParents()) {pending[pid]++;}
+    }
+    return pending;
+}
+
+// Node ids in the order backward() reports them ready, for the topo order it would
+// be given (not yet reversed).
+static std::vector<int> gradReadyOrder(const std::vector<int>&order){
+    std::vector<int> ready;
+    if (order.empty()) {return ready;}
+    auto pending = countConsumers(order);
+    ready.push_back(order.back());
+    for(auto it = order.rbegin(); it != order.rend(); ++it){
+        auto node = Node::GetNode(*it);
+        if (!node) {break;}
+        for (auto pid : node->GetParents()){
+            if (--pending[pid] == 0) {ready.push_back(pid);}
+        }
+    }
+    return ready;
+}
+
+// on_grad_ready is called with each node id as soon as its grad is final: once the
+// last consumer has added into it, which for a leaf param deep in the graph is long
+// before the walk reaches the leaf itself.
+static void backward(std::vector<int>&order,const std::function<void(int)>&on_grad_ready = nullptr){
+    std::unordered_map<int,int> pending;
+    if (on_grad_ready) {pending = countConsumers(order);}
     std::reverse(order.begin(),order.end());
     for(auto n : order){Node::GetNode(n)->ZeroGrad();}
     Node::GetNode(order[0])->setGrad(1.0);
+    if (on_grad_ready) {on_grad_ready(order[0]);}
     for(auto n : order){
         auto node = Node::GetNode(n);
         if (!node){
@@ -69,13 +105,39 @@ static void backward(std::vector<int>&order){
             auto parent = Node::GetNode(parents[0]);
             parent->AddGrad(node->GetGrad()*exp(parent->GetData()));
         }
+        else if (node->GetOp() == "fused") {
+            auto fused = node->GetFused();
+            if (!fused || (int)parents.size() != fused->Arity()) {
+                std::cerr << "Fused node has no op or wrong number of parents" << std::endl;
+                return;
+            }
+            std::vector<double> inputs;
+            inputs.reserve(parents.size());
+            for (auto pid : parents) {
+                auto parent = Node::GetNode(pid);
+                if (!parent) {
+                    std::cerr << "Parent node " << pid << " not found" << std::endl;
+                    return;
+                }
+                inputs.push_back(parent->GetData());
+            }
+            std::vector<double> grads(parents.size(),0.0);
+            fused->Backward(inputs,node->GetGrad(),grads);
+            for (size_t i = 0; i < parents.size(); i++) {
+                Node::GetNode(parents[i])->AddGrad(grads[i]);
+            }
+        }
         else if (node->GetOp().substr(0,4) == "pow_") {
             std::string str_exp = node->GetOp().substr(4);
             auto exp = std::stod(str_exp);
             auto parent = Node::GetNode(parents[0]);
             parent->AddGrad(node->GetGrad()*exp*pow(parent->GetData(),exp-1));
         }
-
+        if (on_grad_ready){
+            for (auto pid : parents){
+                if (--pending[pid] == 0) {on_grad_ready(pid);}
+            }
+        }
     }
 }
 
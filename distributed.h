@@ -0,0 +1,395 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+#include "backward.h"
+#include "node.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Data parallel training across processes on one Linux host.
+// Every worker builds the same graph on its own shard of the batch. Gradients are
+// exchanged through a POSIX shared memory region and averaged with a bucketed
+// allreduce that starts while backward() is still walking the rest of the graph.
+
+// Layout of the shared region: this header, then one gradient slot per rank,
+// then the reduced (averaged) buffer everyone reads back from.
+struct SharedGradHeader{
+    std::atomic<int> arrived;
+    std::atomic<int> sense;
+    std::atomic<int> aborted;
+    int world_size;
+    long num_elems;
+    unsigned long layout_hash;   // rank 0's param layout, written before the first allreduce
+};
+static_assert(std::atomic<int>::is_always_lock_free,"process shared barrier needs lock free atomics");
+
+class SharedGradRegion{
+private:
+    std::string name;
+    SharedGradHeader *header;
+    size_t bytes;
+    pid_t owner;
+    bool local_sense = false;
+private:
+    SharedGradRegion(const std::string &name,SharedGradHeader *header,size_t bytes,pid_t owner)
+        : name(name),header(header),bytes(bytes),owner(owner){}
+
+    static size_t region_bytes(int world_size,long num_elems){
+        return sizeof(SharedGradHeader) + sizeof(double)*num_elems*(world_size + 1);
+    }
+public:
+    using Regionptr = std::shared_ptr<SharedGradRegion>;
+
+    // Creates the named region; fails if one with that name already exists so a live
+    // job's region is never replaced. The creating process unlinks it on destruction;
+    // forked workers inherit the mapping and only unmap it.
+    static Regionptr CreateRegion(const std::string &name,int world_size,long num_elems){
+        if (world_size < 1 || num_elems < 0){
+            throw std::invalid_argument("world size must be >= 1 and num_elems >= 0");
+        }
+        int fd = shm_open(name.c_str(),O_CREAT | O_EXCL | O_RDWR,0600);
+        if (fd < 0 && errno == EEXIST){
+            throw std::runtime_error("shared region " + name + " already exists");
+        }
+        if (fd < 0){
+            throw std::runtime_error("shm_open failed for " + name + ": " + strerror(errno));
+        }
+        size_t bytes = region_bytes(world_size,num_elems);
+        if (ftruncate(fd,bytes) != 0){
+            close(fd);
+            shm_unlink(name.c_str());
+            throw std::runtime_error("ftruncate failed for " + name + ": " + strerror(errno));
+        }
+        void *mem = mmap(nullptr,bytes,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+        close(fd);
+        if (mem == MAP_FAILED){
+            shm_unlink(name.c_str());
+            throw std::runtime_error("mmap failed for " + name + ": " + strerror(errno));
+        }
+        auto header = new (mem) SharedGradHeader();
+        header->arrived.store(0);
+        header->sense.store(0);
+        header->aborted.store(0);
+        header->world_size = world_size;
+        header->num_elems = num_elems;
+        header->layout_hash = 0;
+        return Regionptr(new SharedGradRegion(name,header,bytes,getpid()));
+    }
+
+    // Attaches to a region created by another (non forked) process. Every rank has to
+    // attach before any of them enters Barrier().
+    static Regionptr OpenRegion(const std::string &name){
+        int fd = shm_open(name.c_str(),O_RDWR,0600);
+        if (fd < 0){
+            throw std::runtime_error("shm_open failed for " + name + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd,&st) != 0 || (size_t)st.st_size < sizeof(SharedGradHeader)){
+            close(fd);
+            throw std::runtime_error("shared region " + name + " is not initialised");
+        }
+        void *mem = mmap(nullptr,st.st_size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+        close(fd);
+        if (mem == MAP_FAILED){
+            throw std::runtime_error("mmap failed for " + name + ": " + strerror(errno));
+        }
+        auto header = static_cast<SharedGradHeader*>(mem);
+        if (region_bytes(header->world_size,header->num_elems) != (size_t)st.st_size){
+            munmap(mem,st.st_size);
+            throw std::runtime_error("shared region " + name + " has an unexpected size");
+        }
+        return Regionptr(new SharedGradRegion(name,header,st.st_size,0));
+    }
+
+    ~SharedGradRegion(){
+        munmap(header,bytes);
+        if (owner == getpid()) {shm_unlink(name.c_str());}
+    }
+    SharedGradRegion(const SharedGradRegion&) = delete;
+    SharedGradRegion &operator=(const SharedGradRegion&) = delete;
+
+    int GetWorldSize(){return header->world_size;}
+    long GetNumElems(){return header->num_elems;}
+    double *GetSlot(int rank){
+        return reinterpret_cast<double*>(header + 1) + (long)rank*header->num_elems;
+    }
+    double *GetReduced(){return GetSlot(header->world_size);}
+
+    // Plain fields: publish before a Barrier() and read after it.
+    void SetLayoutHash(unsigned long h){header->layout_hash = h;}
+    unsigned long GetLayoutHash(){return header->layout_hash;}
+
+    // Makes every rank's current and future Barrier() throw instead of waiting on a
+    // peer that will never arrive. Safe to call from any process mapping the region.
+    void Abort(){header->aborted.store(1,std::memory_order_release);}
+    bool IsAborted(){return header->aborted.load(std::memory_order_acquire) != 0;}
+
+    // Sense reversing barrier over all ranks. Only one thread per process may be in it.
+    // Throws std::runtime_error once the region is aborted.
+    void Barrier(){
+        if (IsAborted()){
+            throw std::runtime_error("data parallel region aborted");
+        }
+        local_sense = !local_sense;
+        const int target = local_sense;
+        if (header->arrived.fetch_add(1,std::memory_order_acq_rel) + 1 == header->world_size){
+            header->arrived.store(0,std::memory_order_relaxed);
+            header->sense.store(target,std::memory_order_release);
+            return;
+        }
+        int spins = 0;
+        while (header->sense.load(std::memory_order_acquire) != target){
+            if (IsAborted()){
+                throw std::runtime_error("data parallel region aborted");
+            }
+            if (++spins > 64) {std::this_thread::yield();}
+        }
+    }
+};
+
+class DataParallel{
+private:
+    SharedGradRegion::Regionptr region;
+    int rank;
+    int world_size;
+    long bucket_cap;
+    std::vector<Node::Nodeptr> params;
+    std::unordered_map<int,int> param_index;   // node id -> index in params
+    std::vector<long> offsets;                 // param index -> offset in the grad buffer
+    std::vector<long> bucket_ends;             // exclusive end offset of each bucket
+    std::vector<double> averaged;
+    unsigned long layout_hash = 0;             // 0 until checked against rank 0 on the first step
+
+    // handoff with the comm thread, all guarded by mtx
+    std::mutex mtx;
+    std::condition_variable cv;
+    int buckets_ready = 0;
+    long steps_started = 0;
+    long steps_done = 0;
+    bool stopping = false;
+    std::exception_ptr comm_error;
+    std::thread comm;
+private:
+    // Lays params out in the order backward() reports their grads ready so buckets
+    // fill up front to back while the walk is still going. Params missing from the
+    // graph go last with a zero grad. Returns a hash of the layout.
+    unsigned long layout(const std::vector<int>&order){
+        std::vector<int> seq;
+        std::vector<bool> placed(params.size(),false);
+        for(auto id : gradReadyOrder(order)){
+            auto found = param_index.find(id);
+            if (found != param_index.end() && !placed[found->second]){
+                placed[found->second] = true;
+                seq.push_back(found->second);
+            }
+        }
+        for(int p = 0; p < (int)params.size(); p++){
+            if (!placed[p]) {seq.push_back(p);}
+        }
+        // FNV-1a over the param order, never 0
+        unsigned long h = 14695981039346656037ul;
+        for(auto p : seq) {h = (h ^ (unsigned long)p)*1099511628211ul;}
+        h |= 1;
+        bucket_ends.clear();
+        long off = 0;
+        for(auto p : seq){
+            offsets[p] = off++;
+            if (off - (bucket_ends.empty() ? 0 : bucket_ends.back()) == bucket_cap){
+                bucket_ends.push_back(off);
+            }
+        }
+        if (bucket_ends.empty() || bucket_ends.back() != off) {bucket_ends.push_back(off);}
+        return h;
+    }
+
+    // Every rank derives its layout from its own graph, so on the first step rank 0
+    // publishes its hash and the others compare. Later steps must keep the same
+    // layout. Runs while the comm thread is idle, so this thread may use Barrier().
+    void check_layout(unsigned long h){
+        if (layout_hash != 0){
+            if (h != layout_hash){
+                region->Abort();
+                throw std::runtime_error("param layout changed since the first data parallel step");
+            }
+            return;
+        }
+        if (rank == 0) {region->SetLayoutHash(h);}
+        region->Barrier();
+        if (region->GetLayoutHash() != h){
+            region->Abort();
+            throw std::runtime_error("param layout on rank " + std::to_string(rank) + " doesn't match rank 0");
+        }
+        layout_hash = h;
+    }
+
+    void publish(long filled){
+        std::lock_guard<std::mutex> lock(mtx);
+        while (buckets_ready < (int)bucket_ends.size() && bucket_ends[buckets_ready] <= filled){
+            buckets_ready++;
+        }
+        cv.notify_all();
+    }
+
+    // Bucket b is reduce scattered (rank r sums chunk r of the bucket over every slot)
+    // and then gathered back, one barrier after each phase. Returns false if stopped.
+    bool allreduce_buckets(){
+        const double inv = 1.0/world_size;
+        double *reduced = region->GetReduced();
+        long begin = 0;
+        for(int b = 0; b < (int)bucket_ends.size(); b++){
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock,[&]{return buckets_ready > b || stopping;});
+                if (stopping) {return false;}
+            }
+            const long end = bucket_ends[b];
+            const long len = end - begin;
+            region->Barrier();
+            const long lo = begin + len*rank/world_size;
+            const long hi = begin + len*(rank + 1)/world_size;
+            std::fill(reduced + lo,reduced + hi,0.0);
+            for(int r = 0; r < world_size; r++){
+                const double *slot = region->GetSlot(r);
+                for(long i = lo; i < hi; i++) reduced[i] += slot[i];
+            }
+            for(long i = lo; i < hi; i++) reduced[i] *= inv;
+            region->Barrier();
+            std::copy(reduced + begin,reduced + end,averaged.begin() + begin);
+            begin = end;
+        }
+        return true;
+    }
+
+    // Comm thread body: one allreduce per backward() call for the object's lifetime.
+    void comm_loop(){
+        long seen = 0;
+        while (true){
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock,[&]{return steps_started > seen || stopping;});
+                if (stopping) {return;}
+                seen = steps_started;
+            }
+            std::exception_ptr error;
+            bool finished = false;
+            try {
+                finished = allreduce_buckets();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!finished && !error) {return;}
+            comm_error = error;
+            steps_done = seen;
+            cv.notify_all();
+        }
+    }
+public:
+    // bucket_cap is the number of grads per bucket; smaller buckets start communicating
+    // sooner, larger ones pay for fewer barriers.
+    DataParallel(const SharedGradRegion::Regionptr &region,int rank,const std::vector<Node::Nodeptr>&params,long bucket_cap = 4096)
+        : region(region),rank(rank),world_size(region->GetWorldSize()),bucket_cap(bucket_cap),params(params),
+          offsets(params.size()),averaged(params.size()){
+        if (rank < 0 || rank >= world_size){
+            throw std::invalid_argument("rank out of range for data parallel region");
+        }
+        if ((long)params.size() != region->GetNumElems()){
+            throw std::invalid_argument("number of params doesn't match the shared region");
+        }
+        if (bucket_cap < 1){
+            throw std::invalid_argument("bucket_cap must be >= 1");
+        }
+        for(int p = 0; p < (int)params.size(); p++) {param_index[params[p]->GetId()] = p;}
+        comm = std::thread(&DataParallel::comm_loop,this);
+    }
+
+    ~DataParallel(){
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        comm.join();
+    }
+    DataParallel(const DataParallel&) = delete;
+    DataParallel &operator=(const DataParallel&) = delete;
+
+    // Copies rank 0's param values to every rank so all replicas start identical.
+    void BroadcastParams(){
+        double *reduced = region->GetReduced();
+        if (rank == 0){
+            for(size_t p = 0; p < params.size(); p++) {reduced[p] = params[p]->GetData();}
+        }
+        region->Barrier();
+        for(size_t p = 0; p < params.size(); p++) {params[p]->SetData(reduced[p]);}
+        region->Barrier();
+    }
+
+    // Same contract as ::backward (order is reversed in place). Every rank must call it
+    // on a graph of the same structure. On return each param holds the grad averaged
+    // over all ranks. Throws std::runtime_error if the region was aborted by a peer or
+    // the ranks' param layouts disagree.
+    void backward(std::vector<int>&order){
+        long step;
+        unsigned long h;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            h = layout(order);
+        }
+        check_layout(h);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            buckets_ready = 0;
+            comm_error = nullptr;
+            step = ++steps_started;
+        }
+        cv.notify_all();
+        double *slot = region->GetSlot(rank);
+        long filled = 0;
+        size_t next_bucket = 0;
+        ::backward(order,[&](int id){
+            auto found = param_index.find(id);
+            if (found == param_index.end()) {return;}
+            slot[offsets[found->second]] = params[found->second]->GetGrad();
+            if (++filled == bucket_ends[next_bucket]){
+                publish(filled);
+                next_bucket++;
+            }
+        });
+        for(size_t p = 0; p < params.size(); p++){
+            if (offsets[p] >= filled) {slot[offsets[p]] = 0.0;}
+        }
+        publish((long)params.size());
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock,[&]{return steps_done == step;});
+            if (comm_error) {std::rethrow_exception(comm_error);}
+        }
+        for(size_t p = 0; p < params.size(); p++) {params[p]->setGrad(averaged[offsets[p]]);}
+    }
+
+    // Plain SGD. The averaged grads are bit identical on every rank, so are the updates.
+    void Step(double lr){
+        for(auto &p : params) {p->SetData(p->GetData() - lr*p->GetGrad());}
+    }
+
+    SharedGradRegion::Regionptr GetRegion(){return region;}
+    int GetRank(){return rank;}
+};
+
+#endif // DISTRIBUTED_H
@@ -0,0 +1,283 @@
+#ifndef EXPR_H
+#define EXPR_H
+#include "node.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Compile time expression graphs for formulas that are fixed in the source.
+// The formula is written with the same NodeOps spelling (+ - * / node_pow node_exp
+// node_log node_sqrt) on StaticExpr::Var<I> leaves, and its type is the whole graph.
+// Nothing is allocated: value() and gradient() are plain recursive inline calls the
+// compiler flattens into straight line code. Expressions hold no state, so one can be
+// shared across threads. embed() wraps one as a single "fused" Node.
+namespace StaticExpr{
+
+    // CRTP base so the operators below only match expression types
+    template<class E>
+    struct Expr{
+        const E &self() const {return static_cast<const E&>(*this);}
+    };
+
+    template<class T>
+    using is_expr = std::is_base_of<Expr<T>,T>;
+
+    // eval() returns a Values struct that mirrors the expression tree and holds every
+    // intermediate on the caller's stack; grad() walks it back down.
+    template<int I>
+    struct Var : Expr<Var<I>>{
+        static_assert(I >= 0,"variable index must be >= 0");
+        static constexpr int arity = I + 1;
+        struct Values{double val;};
+        template<size_t N>
+        Values eval(const std::array<double,N>&x) const {return {x[I]};}
+        template<size_t N>
+        void grad(const Values&,double adj,std::array<double,N>&g) const {g[I] += adj;}
+    };
+
+    struct Const : Expr<Const>{
+        static constexpr int arity = 0;
+        struct Values{double val;};
+        double val;
+        explicit Const(double v) : val(v){}
+        template<size_t N>
+        Values eval(const std::array<double,N>&) const {return {val};}
+        template<size_t N>
+        void grad(const Values&,double,std::array<double,N>&) const {}
+    };
+
+    template<class Op,class L,class R>
+    struct Binary : Expr<Binary<Op,L,R>>{
+        static constexpr int arity = L::arity > R::arity ? L::arity : R::arity;
+        struct Values{
+            typename L::Values l;
+            typename R::Values r;
+            double val;
+        };
+        L l;
+        R r;
+        Binary(const L &l,const R &r) : l(l),r(r){}
+        template<size_t N>
+        Values eval(const std::array<double,N>&x) const {
+            auto lv = l.eval(x);
+            auto rv = r.eval(x);
+            return {lv,rv,Op::apply(lv.val,rv.val)};
+        }
+        template<size_t N>
+        void grad(const Values &v,double adj,std::array<double,N>&g) const {
+            l.grad(v.l,adj*Op::dl(v.l.val,v.r.val,v.val),g);
+            r.grad(v.r,adj*Op::dr(v.l.val,v.r.val,v.val),g);
+        }
+    };
+
+    template<class Op,class E>
+    struct Unary : Expr<Unary<Op,E>>{
+        static constexpr int arity = E::arity;
+        struct Values{
+            typename E::Values e;
+            double val;
+        };
+        E e;
+        Unary(const E &e) : e(e){}
+        template<size_t N>
+        Values eval(const std::array<double,N>&x) const {
+            auto ev = e.eval(x);
+            return {ev,Op::apply(ev.val)};
+        }
+        template<size_t N>
+        void grad(const Values &v,double adj,std::array<double,N>&g) const {
+            e.grad(v.e,adj*Op::d(v.e.val,v.val),g);
+        }
+    };
+
+    // e ^ c for a constant exponent, the static form of the runtime "pow_" node
+    template<class E>
+    struct PowConst : Expr<PowConst<E>>{
+        static constexpr int arity = E::arity;
+        struct Values{
+            typename E::Values e;
+            double val;
+        };
+        E e;
+        double c;
+        PowConst(const E &e,double c) : e(e),c(c){}
+        template<size_t N>
+        Values eval(const std::array<double,N>&x) const {
+            auto ev = e.eval(x);
+            return {ev,std::pow(ev.val,c)};
+        }
+        template<size_t N>
+        void grad(const Values &v,double adj,std::array<double,N>&g) const {
+            e.grad(v.e,adj*c*std::pow(v.e.val,c - 1),g);
+        }
+    };
+
+    // Partial derivatives match the runtime rules in backward.h.
+    struct Add{
+        static double apply(double a,double b){return a + b;}
+        static double dl(double,double,double){return 1.0;}
+        static double dr(double,double,double){return 1.0;}
+    };
+    struct Sub{
+        static double apply(double a,double b){return a - b;}
+        static double dl(double,double,double){return 1.0;}
+        static double dr(double,double,double){return -1.0;}
+    };
+    struct Mul{
+        static double apply(double a,double b){return a * b;}
+        static double dl(double,double b,double){return b;}
+        static double dr(double a,double,double){return a;}
+    };
+    struct Div{
+        static double apply(double a,double b){return a / b;}
+        static double dl(double,double b,double){return 1.0/b;}
+        static double dr(double a,double b,double){return -a/(b*b);}
+    };
+    struct Pow{
+        static double apply(double a,double b){return std::pow(a,b);}
+        static double dl(double a,double b,double){return b*std::pow(a,b-1);}
+        static double dr(double a,double,double out){return out*std::log(a);}
+    };
+    struct Negate{
+        static double apply(double a){return -a;}
+        static double d(double,double){return -1.0;}
+    };
+    struct Exp{
+        static double apply(double a){return std::exp(a);}
+        static double d(double,double out){return out;}
+    };
+    struct Log{
+        static double apply(double a){return std::log(a);}
+        static double d(double a,double){return 1.0/a;}
+    };
+    struct Sqrt{
+        static double apply(double a){return std::sqrt(a);}
+        static double d(double,double out){return 1.0/(2.0*out);}
+    };
+
+    template<class E>
+    using Inputs = std::array<double,E::arity>;
+
+    template<class E>
+    inline double value(const Expr<E>&expr,const Inputs<E>&x){
+        return expr.self().eval(x).val;
+    }
+
+    // Returns the value and writes d(expr)/d(x[i]) into g[i].
+    template<class E>
+    inline double gradient(const Expr<E>&expr,const Inputs<E>&x,Inputs<E>&g){
+        const E &e = expr.self();
+        auto v = e.eval(x);
+        g.fill(0.0);
+        e.grad(v,1.0,g);
+        return v.val;
+    }
+
+    // One per fused node. Forward keeps its intermediates, the way a Node keeps its
+    // data, so Backward only re-evaluates if the inputs changed since.
+    template<class E>
+    class FusedExpr : public FusedOp{
+    private:
+        E expr;
+        Inputs<E> saved_inputs{};
+        typename E::Values saved{};
+        bool has_saved = false;
+    public:
+        explicit FusedExpr(const E &expr) : expr(expr){}
+        int Arity() const override {return E::arity;}
+        double Forward(const std::vector<double>&inputs) override {
+            std::copy(inputs.begin(),inputs.end(),saved_inputs.begin());
+            saved = expr.eval(saved_inputs);
+            has_saved = true;
+            return saved.val;
+        }
+        void Backward(const std::vector<double>&inputs,double grad,std::vector<double>&grads) override {
+            Inputs<E> g{};
+            if (!has_saved || !std::equal(inputs.begin(),inputs.end(),saved_inputs.begin())){
+                Forward(inputs);
+            }
+            expr.grad(saved,grad,g);
+            for (int i = 0; i < E::arity; i++) {grads[i] += g[i];}
+        }
+    };
+
+    // Puts the whole expression in the runtime graph as one "fused" node.
+    // inputs[i] feeds Var<i>.
+    template<class E>
+    Node::Nodeptr embed(const Expr<E>&expr,const std::vector<Node::Nodeptr>&inputs){
+        if ((int)inputs.size() != E::arity){
+            throw std::invalid_argument("embed needs " + std::to_string(E::arity) + " input nodes, got " + std::to_string(inputs.size()));
+        }
+        auto result = Node::CreateNode(0.0,"fused");
+        for (auto &in : inputs) {result->addParent(in->GetId());}
+        result->SetFused(std::make_shared<FusedExpr<E>>(expr.self()));
+        return result;
+    }
+}
+
+namespace NodeOps {
+    // Operators on static expressions. Plain doubles on either side become Const.
+    template<class T>
+    using expr_t = typename std::conditional<StaticExpr::is_expr<T>::value,T,StaticExpr::Const>::type;
+
+    template<class L,class R>
+    using enable_expr = typename std::enable_if<
+        (StaticExpr::is_expr<L>::value || StaticExpr::is_expr<R>::value) &&
+        (StaticExpr::is_expr<L>::value || std::is_arithmetic<L>::value) &&
+        (StaticExpr::is_expr<R>::value || std::is_arithmetic<R>::value)>::type;
+
+    template<class T>
+    const T &as_expr(const T &e,std::true_type){return e;}
+    template<class T>
+    StaticExpr::Const as_expr(const T &v,std::false_type){return StaticExpr::Const(v);}
+    template<class T>
+    expr_t<T> as_expr(const T &v){return as_expr(v,StaticExpr::is_expr<T>{});}
+
+    template<class L,class R,class = enable_expr<L,R>>
+    StaticExpr::Binary<StaticExpr::Add,expr_t<L>,expr_t<R>> operator +(const L &x1,const R &x2){
+        return {as_expr(x1),as_expr(x2)};
+    }
+    template<class L,class R,class = enable_expr<L,R>>
+    StaticExpr::Binary<StaticExpr::Sub,expr_t<L>,expr_t<R>> operator -(const L &x1,const R &x2){
+        return {as_expr(x1),as_expr(x2)};
+    }
+    template<class L,class R,class = enable_expr<L,R>>
+    StaticExpr::Binary<StaticExpr::Mul,expr_t<L>,expr_t<R>> operator *(const L &x1,const R &x2){
+        return {as_expr(x1),as_expr(x2)};
+    }
+    template<class L,class R,class = enable_expr<L,R>>
+    StaticExpr::Binary<StaticExpr::Div,expr_t<L>,expr_t<R>> operator /(const L &x1,const R &x2){
+        return {as_expr(x1),as_expr(x2)};
+    }
+    template<class E>
+    StaticExpr::Unary<StaticExpr::Negate,E> operator -(const StaticExpr::Expr<E>&x){
+        return {x.self()};
+    }
+    template<class L,class R>
+    StaticExpr::Binary<StaticExpr::Pow,L,R> node_pow(const StaticExpr::Expr<L>&x1,const StaticExpr::Expr<R>&x2){
+        return {x1.self(),x2.self()};
+    }
+    template<class E>
+    StaticExpr::PowConst<E> node_pow(const StaticExpr::Expr<E>&x,double y){
+        return {x.self(),y};
+    }
+    template<class E>
+    StaticExpr::Unary<StaticExpr::Exp,E> node_exp(const StaticExpr::Expr<E>&x){
+        return {x.self()};
+    }
+    template<class E>
+    StaticExpr::Unary<StaticExpr::Log,E> node_log(const StaticExpr::Expr<E>&x){
+        return {x.self()};
+    }
+    template<class E>
+    StaticExpr::Unary<StaticExpr::Sqrt,E> node_sqrt(const StaticExpr::Expr<E>&x){
+        return {x.self()};
+    }
+}
+#endif // EXPR_H
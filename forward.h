@@ -111,6 +111,24 @@ static void forward(const std::vector<int>&order){
             auto parent = Node::GetNode(parents[0]);
             node->SetData(sqrt(parent->GetData()));
         }
+        else if (node->GetOp() == "fused"){
+            auto fused = node->GetFused();
+            if (!fused || (int)parents.size() != fused->Arity()) {
+                std::cerr << "Fused node has no op or wrong number of parents" << std::endl;
+                return;
+            }
+            std::vector<double> inputs;
+            inputs.reserve(parents.size());
+            for(auto pid : parents){
+                auto parent = Node::GetNode(pid);
+                if (!parent) {
+                    std::cerr << "Parent node " << pid << " not found" << std::endl;
+                    return;
+                }
+                inputs.push_back(parent->GetData());
+            }
+            node->SetData(fused->Forward(inputs));
+        }
         else if (node->GetOp().substr(0,4) == "pow_"){
             if (parents.empty()){
                  std::cerr << "No parents for pow_ "<< node->GetOp().substr(4) << " opreation" << std::endl;
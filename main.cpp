@@ -7,6 +7,13 @@
 #include "forward.h"
 #include "backward.h"
 #include "tensor.h"
+#include "reduction.h"
+#include "distributed.h"
+#include "expr.h"
+#include <chrono>
+#include <limits>
+#include <random>
+#include <sys/wait.h>
 void testBasicOperations() {
     using namespace NodeOps;
     std::cout << "=== Testing Basic Operations ===" << std::endl;
@@ -209,6 +216,403 @@ void testChainRule() {
     std::cout << std::endl;
 }
 
+// deterministic, tie free test data for the finite difference checks
+Tensor::Tensorptr makeTestTensor(const std::vector<int>&shape,double seed) {
+    auto t = Tensor::CreateZeros(shape);
+    for (int i = 0; i < t->GetTotalSize(); i++) t->SetDataElem(i,std::sin(1.7 * i + seed) * 2.0);
+    return t;
+}
+
+// largest gap between dx and the central differences of loss() with respect to x
+template<class F>
+double finiteDiffError(const Tensor::Tensorptr &x,const Tensor::Tensorptr &dx,F loss) {
+    const double eps = 1e-6;
+    double max_err = 0.0;
+    for (int i = 0; i < x->GetTotalSize(); i++) {
+        double orig = x->GetDataElem(i);
+        x->SetDataElem(i,orig + eps);
+        double up = loss();
+        x->SetDataElem(i,orig - eps);
+        double down = loss();
+        x->SetDataElem(i,orig);
+        max_err = std::max(max_err,std::fabs((up - down) / (2 * eps) - dx->GetDataElem(i)));
+    }
+    return max_err;
+}
+
+void testTensorReductions() {
+    using namespace TensorOps;
+    std::cout << "=== Testing Tensor Reductions ===" << std::endl;
+
+    auto t = Tensor::CreateTensor({1,2,3,4,5,6},{2,3});
+    auto s0 = sum(t,0);   // {5,7,9}
+    auto s1 = sum(t,1);   // {6,15}
+    std::cout << "sum axis 0: " << s0->GetDataElem(0) << ", " << s0->GetDataElem(1) << ", " << s0->GetDataElem(2) << std::endl;
+    std::cout << "sum axis 1: " << s1->GetDataElem(0) << ", " << s1->GetDataElem(1) << std::endl;
+    std::cout << "mean all: " << mean(t)->GetDataElem(0) << " (expected 3.5)" << std::endl;
+    std::cout << "max axis 1: " << max(t,1)->GetDataElem(0) << ", " << max(t,1)->GetDataElem(1) << std::endl;
+
+    // large logits would overflow a naive exp
+    auto big = Tensor::CreateTensor({1000,1001,1002},{3});
+    std::cout << "logsumexp of {1000,1001,1002}: " << logsumexp(big)->GetDataElem(0)
+              << " (expected " << 1002 + log(1 + exp(-1.0) + exp(-2.0)) << ")" << std::endl;
+    auto sm = softmax(big);
+    std::cout << "softmax: " << sm->GetDataElem(0) << ", " << sm->GetDataElem(1) << ", " << sm->GetDataElem(2) << std::endl;
+
+    // cross entropy gradient against central differences
+    auto logits = Tensor::CreateTensor({0.2,-1.0,3.0, 1.5,0.3,-0.7},{2,3});
+    std::vector<int> targets = {2,0};
+    auto dlogits = cross_entropy_backward(Tensor::CreateScalar(1.0),logits,targets);
+    std::cout << "cross_entropy loss: " << cross_entropy(logits,targets)->GetDataElem(0) << std::endl;
+    std::cout << "cross_entropy grad max error vs finite diff: "
+              << finiteDiffError(logits,dlogits,[&]{return cross_entropy(logits,targets)->GetDataElem(0);}) << std::endl;
+
+    // every backward against central differences of sum(w * op(x)), over all axes and the full reduction
+    auto x = makeTestTensor({2,2,3},0.4);
+    double err_sum = 0.0, err_mean = 0.0, err_max = 0.0, err_lse = 0.0, err_sm = 0.0, err_lsm = 0.0;
+    for (int axis = -1; axis < 3; axis++) {
+        // axis -1 stands for the full reduction here
+        std::vector<int> reduced;
+        if (axis >= 0) {
+            reduced = x->GetShape();
+            reduced.erase(reduced.begin() + axis);
+        }
+        auto w = makeTestTensor(reduced,1.1);
+        auto reduce = [&](Tensor::Tensorptr (*all)(const Tensor::Tensorptr&),
+                          Tensor::Tensorptr (*along)(const Tensor::Tensorptr&,int)) {
+            return [=]{return sum(w * (axis < 0 ? all(x) : along(x,axis)))->GetDataElem(0);};
+        };
+        auto dsum = axis < 0 ? sum_backward(w,x->GetShape()) : sum_backward(w,x->GetShape(),axis);
+        err_sum = std::max(err_sum,finiteDiffError(x,dsum,reduce(sum,sum)));
+        auto dmean = axis < 0 ? mean_backward(w,x->GetShape()) : mean_backward(w,x->GetShape(),axis);
+        err_mean = std::max(err_mean,finiteDiffError(x,dmean,reduce(mean,mean)));
+        auto dmax = axis < 0 ? max_backward(w,x,max(x)) : max_backward(w,x,max(x,axis),axis);
+        err_max = std::max(err_max,finiteDiffError(x,dmax,reduce(max,max)));
+        auto dlse = axis < 0 ? logsumexp_backward(w,x,logsumexp(x)) : logsumexp_backward(w,x,logsumexp(x,axis),axis);
+        err_lse = std::max(err_lse,finiteDiffError(x,dlse,reduce(logsumexp,logsumexp)));
+        if (axis < 0) continue;
+
+        auto wf = makeTestTensor(x->GetShape(),2.3);
+        auto dsm = softmax_backward(wf,softmax(x,axis),axis);
+        err_sm = std::max(err_sm,finiteDiffError(x,dsm,[&]{return sum(wf * softmax(x,axis))->GetDataElem(0);}));
+        auto dlsm = log_softmax_backward(wf,log_softmax(x,axis),axis);
+        err_lsm = std::max(err_lsm,finiteDiffError(x,dlsm,[&]{return sum(wf * log_softmax(x,axis))->GetDataElem(0);}));
+    }
+    std::cout << "Max error vs finite diff on [2,2,3], all axes:" << std::endl;
+    std::cout << "  sum " << err_sum << ", mean " << err_mean << ", max " << err_max
+              << ", logsumexp " << err_lse << std::endl;
+    std::cout << "  softmax " << err_sm << ", log_softmax " << err_lsm << std::endl;
+
+    // a fully masked row gives softmax 0 and log_softmax -inf instead of nan
+    const double ninf = -std::numeric_limits<double>::infinity();
+    auto masked = Tensor::CreateTensor({ninf,ninf, 0.0,1.0},{2,2});
+    auto msm = softmax(masked);
+    auto mlsm = log_softmax(masked);
+    std::cout << "masked row: softmax " << msm->GetDataElem(0) << ", " << msm->GetDataElem(1)
+              << ", log_softmax " << mlsm->GetDataElem(0) << ", " << mlsm->GetDataElem(1) << std::endl;
+
+    // shapes big enough to take the split-slab paths, against plain loops:
+    // a full reduction, the leading axis of narrow rows and the leading axis of wide rows
+    double err_big = 0.0;
+    for (auto shape : std::vector<std::vector<int>>{{1 << 16},{4096,16},{32,2048}}) {
+        auto xb = makeTestTensor(shape,0.9);
+        long len = shape[0], inner = xb->GetTotalSize() / len;
+        auto bs = shape.size() == 1 ? sum(xb) : sum(xb,0);
+        auto bm = shape.size() == 1 ? max(xb) : max(xb,0);
+        auto bl = shape.size() == 1 ? logsumexp(xb) : logsumexp(xb,0);
+        for (long i = 0; i < inner; i++) {
+            double s = 0.0, m = xb->GetDataElem(i), e = 0.0;
+            for (long k = 0; k < len; k++) {
+                s += xb->GetDataElem(k * inner + i);
+                m = std::max(m,xb->GetDataElem(k * inner + i));
+            }
+            for (long k = 0; k < len; k++) e += std::exp(xb->GetDataElem(k * inner + i) - m);
+            err_big = std::max(err_big,std::fabs(bs->GetDataElem(i) - s) / len);
+            err_big = std::max(err_big,std::fabs(bm->GetDataElem(i) - m));
+            err_big = std::max(err_big,std::fabs(bl->GetDataElem(i) - (m + std::log(e))));
+        }
+    }
+    std::cout << "Large reductions max error vs plain loops: " << err_big << std::endl;
+    std::cout << std::endl;
+}
+
+// One data parallel worker: linear regression on its own shard, graph built once and
+// refilled every iteration. check is a second region the same size as region, used to
+// compare the allreduced grads against the mean of every rank's local grads.
+// Exit code 0 = grads averaged correctly, converged and params match on every rank.
+int runDataParallelWorker(const SharedGradRegion::Regionptr &region,const SharedGradRegion::Regionptr &check,
+                          int rank,int features,int batch,int iters) {
+    using namespace NodeOps;
+    std::vector<Node::Nodeptr> params;
+    for (int f = 0; f <= features; f++) params.push_back(Node::CreateNode(0.01 * rank));
+    // the registry only holds weak refs, so every intermediate node is kept in graph
+    std::vector<Node::Nodeptr> xs, ys, graph;
+    Node::Nodeptr loss;
+    for (int s = 0; s < batch; s++) {
+        auto pred = params[features];
+        for (int f = 0; f < features; f++) {
+            xs.push_back(Node::CreateNode(0.0));
+            graph.push_back(params[f] * xs.back());
+            pred = pred + graph.back();
+            graph.push_back(pred);
+        }
+        ys.push_back(Node::CreateNode(0.0));
+        auto err = pred - ys.back();
+        graph.push_back(err);
+        graph.push_back(err * err);
+        loss = loss ? loss + graph.back() : graph.back();
+        graph.push_back(loss);
+    }
+    graph.push_back(Node::CreateNode(batch));
+    loss = loss / graph.back();
+
+    DataParallel dp(region,rank,params,16);
+    dp.BroadcastParams();
+    std::mt19937 rng(1234 + rank);
+    std::uniform_real_distribution<double> dist(-1.0,1.0);
+    double first_loss = 0.0;
+    bool mean_ok = true;
+    for (int it = 0; it < iters; it++) {
+        for (int s = 0; s < batch; s++) {
+            double y = 0.5;
+            for (int f = 0; f < features; f++) {
+                double x = dist(rng);
+                xs[s * features + f]->SetData(x);
+                y += x * (f % 3 - 1);
+            }
+            ys[s]->SetData(y);
+        }
+        auto order = Node::topoSort(loss);
+        forward(order);
+        if (it == 0) first_loss = loss->GetData();
+        bool verify = it == 0 || it == iters - 1;
+        if (verify) {
+            // plain local backward first, published so every rank can form the mean
+            auto local_order = order;
+            backward(local_order);
+            double *local = check->GetSlot(rank);
+            for (int p = 0; p <= features; p++) local[p] = params[p]->GetGrad();
+        }
+        dp.backward(order);
+        if (verify) {
+            check->Barrier();
+            for (int p = 0; p <= features; p++) {
+                double mean = 0.0;
+                for (int r = 0; r < check->GetWorldSize(); r++) mean += check->GetSlot(r)[p];
+                mean /= check->GetWorldSize();
+                mean_ok = mean_ok && std::fabs(params[p]->GetGrad() - mean) <= 1e-12 * (1.0 + std::fabs(mean));
+            }
+            check->Barrier();
+        }
+        dp.Step(0.1);
+    }
+
+    double *slot = region->GetSlot(rank);
+    for (int p = 0; p <= features; p++) slot[p] = params[p]->GetData();
+    region->Barrier();
+    bool same = true;
+    for (int r = 0; r < region->GetWorldSize(); r++) {
+        same = same && std::memcmp(slot, region->GetSlot(r), sizeof(double) * (features + 1)) == 0;
+    }
+    region->Barrier();
+    if (!mean_ok) return 3;
+    if (!same) return 1;
+    return loss->GetData() < first_loss ? 0 : 2;
+}
+
+void testDataParallelScaling(int max_procs) {
+    std::cout << "=== Testing Data Parallel Scaling ===" << std::endl;
+    const int features = 32, batch = 16, iters = 50;
+    double base = 0.0;
+    for (int procs = 1; procs <= max_procs; procs++) {
+        // per process names so concurrent runs don't collide
+        std::string name = "/autograd_dp_test_" + std::to_string(getpid());
+        auto region = SharedGradRegion::CreateRegion(name,procs,features + 1);
+        auto check = SharedGradRegion::CreateRegion(name + "_check",procs,features + 1);
+        std::cout.flush();
+        auto start = std::chrono::steady_clock::now();
+        for (int rank = 0; rank < procs; rank++) {
+            pid_t pid = fork();
+            if (pid != 0) continue;
+            int code = 4;
+            try {
+                code = runDataParallelWorker(region,check,rank,features,batch,iters);
+            } catch (const std::exception &e) {
+                std::cerr << "rank " << rank << ": " << e.what() << std::endl;
+            }
+            if (code != 0) {region->Abort(); check->Abort();}
+            _exit(code);
+        }
+        // a rank that fails or dies aborts the regions so its peers leave their barriers
+        bool ok = true;
+        for (int done = 0; done < procs; done++) {
+            int status = 0;
+            if (waitpid(-1,&status,0) < 0) break;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                ok = false;
+                region->Abort();
+                check->Abort();
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double throughput = procs * batch * iters / secs;
+        if (procs == 1) base = throughput;
+        std::cout << procs << " procs: " << throughput << " samples/s, speedup " << throughput / base
+                  << (ok ? " (grads averaged, params identical, loss decreased)" : " (FAILED)") << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+// Multiplies like "*" and, when backward reaches it, waits for the first bucket of
+// averaged grads to show up in the shared region.
+class BucketProbe : public FusedOp {
+public:
+    const double *reduced;
+    long bucket;
+    bool seen = false;
+    BucketProbe(const double *reduced,long bucket) : reduced(reduced),bucket(bucket) {}
+    int Arity() const override {return 2;}
+    double Forward(const std::vector<double>&in) override {return in[0] * in[1];}
+    void Backward(const std::vector<double>&in,double grad,std::vector<double>&grads) override {
+        grads[0] += grad * in[1];
+        grads[1] += grad * in[0];
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (!seen && std::chrono::steady_clock::now() < deadline) {
+            seen = std::all_of(reduced,reduced + bucket,[](double v){return v != 0.0;});
+            std::this_thread::yield();
+        }
+    }
+};
+
+void testGradReadyOrder() {
+    using namespace NodeOps;
+    std::cout << "=== Testing Grad Ready Order ===" << std::endl;
+    // h = w_199 * (... (w_1 * (w_0 * h0))), so backward visits the params only at the end
+    const int depth = 200;
+    const long bucket = 16;
+    std::string name = "/autograd_ready_test_" + std::to_string(getpid());
+    auto region = SharedGradRegion::CreateRegion(name,1,depth);
+    std::vector<Node::Nodeptr> params, chain;
+    chain.push_back(Node::CreateNode(1.0));
+    auto probe = std::make_shared<BucketProbe>(region->GetReduced(),bucket);
+    for (int i = 0; i < depth; i++) {
+        params.push_back(Node::CreateNode(1.0 + 0.001 * i));
+        if (i == 0) {
+            // the last interior node backward runs
+            chain.push_back(Node::CreateNode(0.0,"fused"));
+            chain.back()->addParent(params[0]->GetId());
+            chain.back()->addParent(chain[0]->GetId());
+            chain.back()->SetFused(probe);
+        } else {
+            chain.push_back(params[i] * chain.back());
+        }
+    }
+    auto order = Node::topoSort(chain.back());
+    forward(order);
+
+    // plain backward: each w_i is reported right after the node that consumes it
+    auto ready_order = order;
+    std::vector<int> ready;
+    backward(ready_order,[&](int id){ready.push_back(id);});
+    auto at = [&](int id){return std::find(ready.begin(),ready.end(),id) - ready.begin();};
+    bool early = at(params[depth - 1]->GetId()) < at(chain[1]->GetId());
+    std::vector<double> local;
+    for (auto &p : params) local.push_back(p->GetGrad());
+
+    DataParallel dp(region,0,params,bucket);
+    auto dp_order = order;
+    dp.backward(dp_order);
+    bool same = true;
+    for (int i = 0; i < depth; i++) same = same && params[i]->GetGrad() == local[i];
+    std::cout << "last param reported ready before the last interior node: " << (early ? "yes" : "no") << std::endl;
+    std::cout << "first bucket averaged before the last interior node ran: " << (probe->seen ? "yes" : "no") << std::endl;
+    std::cout << "data parallel grads match plain backward: " << (same ? "yes" : "no") << std::endl;
+    std::cout << std::endl;
+}
+
+void testStaticExpression() {
+    using namespace NodeOps;
+    std::cout << "=== Testing Static Expression ===" << std::endl;
+
+    // same formula as testComplexExpression: f(x,y) = (x*y + exp(x)) / sqrt(y)
+    StaticExpr::Var<0> x;
+    StaticExpr::Var<1> y;
+    auto f = (x * y + node_exp(x)) / node_sqrt(y);
+
+    std::array<double,2> grads;
+    double value = StaticExpr::gradient(f,{2.0,4.0},grads);
+    std::cout << "Static result = " << value << std::endl;
+    std::cout << "Static gradients: dx = " << grads[0] << ", dy = " << grads[1] << std::endl;
+    double fv = StaticExpr::value(f,{2.0,4.0});
+    std::cout << "Static value = " << fv << " (expected " << (2.0 * 4.0 + exp(2.0)) / sqrt(4.0)
+              << ", same as gradient: " << (fv == value ? "yes" : "no") << ")" << std::endl;
+
+    // embedded as a single fused node inside a runtime graph: g = f(a,b) * c
+    auto a = Node::CreateNode(2.0);
+    auto b = Node::CreateNode(4.0);
+    auto c = Node::CreateNode(3.0);
+    auto fused = StaticExpr::embed(f,{a,b});
+    auto g = fused * c;
+    auto order = Node::topoSort(g);
+    forward(order);
+    backward(order);
+    std::cout << "Fused node result = " << g->GetData() << " (expected " << 3.0 * value << ")" << std::endl;
+    std::cout << "Fused gradients: da = " << a->GetGrad() << ", db = " << b->GetGrad()
+              << ", dc = " << c->GetGrad() << std::endl;
+
+    // constants, pow and negate: h(x) = -(x^3) + 2*x - pow(x,x)
+    auto h = -node_pow(x,3.0) + 2.0 * x - node_pow(x,x);
+    std::array<double,1> dh;
+    double hv = StaticExpr::gradient(h,{1.5},dh);
+    double expected_dh = -3.0 * 1.5 * 1.5 + 2.0 - pow(1.5,1.5) * (log(1.5) + 1.0);
+    std::cout << "h(1.5) = " << hv << " (value() " << StaticExpr::value(h,{1.5}) << "), dh = " << dh[0]
+              << " (expected " << expected_dh << ")" << std::endl;
+
+    // cost of the runtime graph vs the static expression for the same gradient
+    const int iters = 20000;
+    auto rx = Node::CreateNode(2.0);
+    auto ry = Node::CreateNode(4.0);
+    auto rxy = rx * ry;
+    auto rexp = node_exp(rx);
+    auto rnum = rxy + rexp;
+    auto rsqrt = node_sqrt(ry);
+    auto rf = rnum / rsqrt;
+    double sink = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; i++) {
+        rx->SetData(2.0 + i * 1e-6);
+        auto rorder = Node::topoSort(rf);
+        forward(rorder);
+        backward(rorder);
+        sink += rx->GetGrad();
+    }
+    double runtime_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; i++) {
+        StaticExpr::gradient(f,{2.0 + i * 1e-6,4.0},grads);
+        sink -= grads[0];
+    }
+    double static_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Runtime graph: " << runtime_secs * 1e9 / iters << " ns/grad, static: "
+              << static_secs * 1e9 / iters << " ns/grad (checksum diff " << sink << ")" << std::endl;
+
+    // f holds no state, so threads can share it
+    std::vector<std::thread> threads;
+    std::vector<double> thread_dx(4);
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&,t] {
+            std::array<double,2> g;
+            for (int i = 0; i < 10000; i++) StaticExpr::gradient(f,{1.0 + t,4.0},g);
+            thread_dx[t] = g[0];
+        });
+    }
+    for (auto &th : threads) th.join();
+    bool threads_ok = true;
+    for (int t = 0; t < 4; t++) threads_ok = threads_ok && std::fabs(thread_dx[t] - (4.0 + exp(1.0 + t)) / 2.0) < 1e-12;
+    std::cout << "Shared expression across threads: " << (threads_ok ? "ok" : "FAILED") << std::endl;
+    std::cout << std::endl;
+}
+
 int main() {
     std::cout << std::fixed << std::setprecision(6);
     
@@ -253,5 +657,11 @@ int main() {
     Tensor& ones_tensor = *ones_tensor_ptr;
     std::cout << "Size of scalar tensor " <<ones_tensor.GetTotalSize() << "\n";
     std::cout << "scalar tensor value " << ones_tensor(2,3) << std::endl;
+    std::cout << std::endl;
+
+    testTensorReductions();
+    testStaticExpression();
+    testGradReadyOrder();
+    testDataParallelScaling(std::max(2u,std::thread::hardware_concurrency()));
     return 0;
 }
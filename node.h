@@ -9,6 +9,17 @@
 #include <unordered_set>
 #include <vector>
 
+// Op of a "fused" node: a whole expression evaluated as one node. Gets the parents'
+// data in parent order and returns the value, or adds d(value)/d(parent)*grad into grads.
+// Each fused node owns its op, which may keep what Forward computed for Backward.
+class FusedOp{
+public:
+    virtual ~FusedOp() = default;
+    virtual int Arity() const = 0;
+    virtual double Forward(const std::vector<double>&inputs) = 0;
+    virtual void Backward(const std::vector<double>&inputs,double grad,std::vector<double>&grads) = 0;
+};
+
 class Node :public std::enable_shared_from_this<Node>{
 private:
     double data;
@@ -18,6 +29,7 @@ private:
     inline static std::unordered_map<int, std::weak_ptr<Node>> registry;
     std::vector<int> prev;
     double grad=0.0;
+    std::shared_ptr<FusedOp> fused;
 private:
     Node(double data , const std::string &op) : data(data),op(op), grad(0.0),id(next_id++){}
 public:
@@ -44,6 +56,8 @@ public:
         return order;
     }
     void addParent(const int pid){prev.push_back(pid);}
+    void SetFused(std::shared_ptr<FusedOp> op){fused = std::move(op);}
+    std::shared_ptr<FusedOp> GetFused(){return fused;}
     double GetData(){return data;}
     double GetGrad(){return grad;}
     std::string GetOp(){return op;}
@@ -0,0 +1,603 @@
+#ifndef REDUCTION_H
+#define REDUCTION_H
+#include "tensor.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// Axis reductions, softmax and cross-entropy on tensors.
+// Every kernel views the tensor as [outer, len, inner] around the reduced axis so the
+// innermost loop always walks contiguous memory (vectorizable), and the work is split
+// across threads when built with -fopenmp. Backward functions take the
+// upstream grad and recompute what they need instead of keeping intermediates around.
+
+// OpenMP pragmas only when built with -fopenmp, so plain -Wall builds stay quiet
+#ifdef _OPENMP
+#define REDUCE_OMP(x) _Pragma(#x)
+#else
+#define REDUCE_OMP(x)
+#endif
+
+namespace TensorOps{
+
+    // below this many elements the thread startup costs more than the work
+    static constexpr long REDUCE_PARALLEL_MIN = 1 << 15;
+    // column block one thread owns when a single slab is split across its rows
+    static constexpr long REDUCE_INNER_BLOCK = 512;
+
+    struct AxisSplit{
+        long outer = 1;
+        long len = 1;
+        long inner = 1;
+        std::vector<int> out_shape;
+    };
+
+    static AxisSplit split_axis(const std::vector<int>&shape,int axis){
+        int ndim = shape.size();
+        if (axis < 0) axis += ndim;
+        if (axis < 0 || axis >= ndim){
+            throw std::invalid_argument("axis out of range for reduction");
+        }
+        AxisSplit split;
+        for(int d = 0; d < ndim; d++){
+            if (d < axis) split.outer *= shape[d];
+            else if (d > axis) split.inner *= shape[d];
+            if (d != axis) split.out_shape.push_back(shape[d]);
+        }
+        split.len = shape[axis];
+        return split;
+    }
+
+    // reduce over every element, result is a 0D tensor
+    static AxisSplit split_all(const std::vector<int>&shape){
+        AxisSplit split;
+        for(auto dim : shape) split.len *= dim;
+        return split;
+    }
+
+    // ---- forward kernels ----
+    // With outer > 1 threads split the outer loop. A single [len, inner] slab (full
+    // reductions, or the leading axis) is split instead over len with per-thread
+    // partials, or over column blocks when rows are at least two blocks wide.
+
+    static void sum_kernel(const double *x,double *out,const AxisSplit &s){
+        const long outer = s.outer, len = s.len, inner = s.inner;
+        if (inner == 1 && outer == 1){
+            double acc = 0.0;
+            REDUCE_OMP(omp parallel for simd reduction(+:acc) if(len >= REDUCE_PARALLEL_MIN))
+            for(long k = 0; k < len; k++) acc += x[k];
+            out[0] = acc;
+            return;
+        }
+        if (inner == 1){
+            REDUCE_OMP(omp parallel for if(outer*len >= REDUCE_PARALLEL_MIN))
+            for(long o = 0; o < outer; o++){
+                const double *row = x + o*len;
+                double acc = 0.0;
+                REDUCE_OMP(omp simd reduction(+:acc))
+                for(long k = 0; k < len; k++) acc += row[k];
+                out[o] = acc;
+            }
+            return;
+        }
+        if (outer == 1 && inner < 2*REDUCE_INNER_BLOCK){
+            for(long i = 0; i < inner; i++) out[i] = 0.0;
+            REDUCE_OMP(omp parallel for reduction(+:out[:inner]) if(len*inner >= REDUCE_PARALLEL_MIN))
+            for(long k = 0; k < len; k++){
+                const double *slice = x + k*inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < inner; i++) out[i] += slice[i];
+            }
+            return;
+        }
+        if (outer == 1){
+            REDUCE_OMP(omp parallel for if(len*inner >= REDUCE_PARALLEL_MIN))
+            for(long i0 = 0; i0 < inner; i0 += REDUCE_INNER_BLOCK){
+                const long i1 = std::min(inner,i0 + REDUCE_INNER_BLOCK);
+                for(long i = i0; i < i1; i++) out[i] = 0.0;
+                for(long k = 0; k < len; k++){
+                    const double *slice = x + k*inner;
+                    REDUCE_OMP(omp simd)
+                    for(long i = i0; i < i1; i++) out[i] += slice[i];
+                }
+            }
+            return;
+        }
+        REDUCE_OMP(omp parallel for if(outer*len*inner >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < outer; o++){
+            double *acc = out + o*inner;
+            for(long i = 0; i < inner; i++) acc[i] = 0.0;
+            for(long k = 0; k < len; k++){
+                const double *slice = x + (o*len + k)*inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < inner; i++) acc[i] += slice[i];
+            }
+        }
+    }
+
+    static void max_kernel(const double *x,double *out,const AxisSplit &s){
+        const long outer = s.outer, len = s.len, inner = s.inner;
+        if (len == 0){
+            throw std::invalid_argument("max of an empty axis");
+        }
+        if (inner == 1 && outer == 1){
+            double m = x[0];
+            REDUCE_OMP(omp parallel for simd reduction(max:m) if(len >= REDUCE_PARALLEL_MIN))
+            for(long k = 1; k < len; k++) m = x[k] > m ? x[k] : m;
+            out[0] = m;
+            return;
+        }
+        if (inner == 1){
+            REDUCE_OMP(omp parallel for if(outer*len >= REDUCE_PARALLEL_MIN))
+            for(long o = 0; o < outer; o++){
+                const double *row = x + o*len;
+                double m = row[0];
+                REDUCE_OMP(omp simd reduction(max:m))
+                for(long k = 1; k < len; k++) m = row[k] > m ? row[k] : m;
+                out[o] = m;
+            }
+            return;
+        }
+        if (outer == 1 && inner < 2*REDUCE_INNER_BLOCK){
+            for(long i = 0; i < inner; i++) out[i] = x[i];
+            REDUCE_OMP(omp parallel for reduction(max:out[:inner]) if(len*inner >= REDUCE_PARALLEL_MIN))
+            for(long k = 1; k < len; k++){
+                const double *slice = x + k*inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < inner; i++) out[i] = slice[i] > out[i] ? slice[i] : out[i];
+            }
+            return;
+        }
+        if (outer == 1){
+            REDUCE_OMP(omp parallel for if(len*inner >= REDUCE_PARALLEL_MIN))
+            for(long i0 = 0; i0 < inner; i0 += REDUCE_INNER_BLOCK){
+                const long i1 = std::min(inner,i0 + REDUCE_INNER_BLOCK);
+                for(long i = i0; i < i1; i++) out[i] = x[i];
+                for(long k = 1; k < len; k++){
+                    const double *slice = x + k*inner;
+                    REDUCE_OMP(omp simd)
+                    for(long i = i0; i < i1; i++) out[i] = slice[i] > out[i] ? slice[i] : out[i];
+                }
+            }
+            return;
+        }
+        REDUCE_OMP(omp parallel for if(outer*len*inner >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < outer; o++){
+            double *m = out + o*inner;
+            const double *first = x + o*len*inner;
+            for(long i = 0; i < inner; i++) m[i] = first[i];
+            for(long k = 1; k < len; k++){
+                const double *slice = x + (o*len + k)*inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < inner; i++) m[i] = slice[i] > m[i] ? slice[i] : m[i];
+            }
+        }
+    }
+
+    // two passes: running max, then sum of exp(x - max). out gets max + log(sum).
+    // Slots whose max is infinite keep the max: for all -inf input x - max is nan.
+    static void logsumexp_kernel(const double *x,double *out,const AxisSplit &s){
+        const long outer = s.outer, len = s.len, inner = s.inner;
+        max_kernel(x,out,s);
+        if (inner == 1 && outer == 1){
+            const double m = out[0];
+            if (std::isinf(m)) return;
+            double acc = 0.0;
+            REDUCE_OMP(omp parallel for simd reduction(+:acc) if(len >= REDUCE_PARALLEL_MIN))
+            for(long k = 0; k < len; k++) acc += std::exp(x[k] - m);
+            out[0] = m + std::log(acc);
+            return;
+        }
+        if (inner == 1){
+            REDUCE_OMP(omp parallel for if(outer*len >= REDUCE_PARALLEL_MIN))
+            for(long o = 0; o < outer; o++){
+                const double *row = x + o*len;
+                const double m = out[o];
+                if (std::isinf(m)) continue;
+                double acc = 0.0;
+                REDUCE_OMP(omp simd reduction(+:acc))
+                for(long k = 0; k < len; k++) acc += std::exp(row[k] - m);
+                out[o] = m + std::log(acc);
+            }
+            return;
+        }
+        std::vector<double> sums(outer*inner,0.0);
+        double *acc = sums.data();
+        if (outer == 1 && inner < 2*REDUCE_INNER_BLOCK){
+            REDUCE_OMP(omp parallel for reduction(+:acc[:inner]) if(len*inner >= REDUCE_PARALLEL_MIN))
+            for(long k = 0; k < len; k++){
+                const double *slice = x + k*inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < inner; i++) acc[i] += std::exp(slice[i] - out[i]);
+            }
+        }
+        else if (outer == 1){
+            REDUCE_OMP(omp parallel for if(len*inner >= REDUCE_PARALLEL_MIN))
+            for(long i0 = 0; i0 < inner; i0 += REDUCE_INNER_BLOCK){
+                const long i1 = std::min(inner,i0 + REDUCE_INNER_BLOCK);
+                for(long k = 0; k < len; k++){
+                    const double *slice = x + k*inner;
+                    REDUCE_OMP(omp simd)
+                    for(long i = i0; i < i1; i++) acc[i] += std::exp(slice[i] - out[i]);
+                }
+            }
+        }
+        else {
+            REDUCE_OMP(omp parallel for if(outer*len*inner >= REDUCE_PARALLEL_MIN))
+            for(long o = 0; o < outer; o++){
+                const double *m = out + o*inner;
+                double *a = acc + o*inner;
+                for(long k = 0; k < len; k++){
+                    const double *slice = x + (o*len + k)*inner;
+                    REDUCE_OMP(omp simd)
+                    for(long i = 0; i < inner; i++) a[i] += std::exp(slice[i] - m[i]);
+                }
+            }
+        }
+        for(long r = 0; r < outer*inner; r++){
+            if (!std::isinf(out[r])) out[r] += std::log(acc[r]);
+        }
+    }
+
+    // y = x - lse (log_softmax) or exp(x - lse) (softmax), lse broadcast over the axis.
+    // An all -inf slot has lse = -inf; it gets softmax 0 and log_softmax -inf, not nan.
+    template<bool Exp>
+    static void softmax_kernel(const double *x,const double *lse,double *y,const AxisSplit &s){
+        const long outer = s.outer, len = s.len, inner = s.inner;
+        const double ninf = -std::numeric_limits<double>::infinity();
+        if (inner == 1){
+            REDUCE_OMP(omp parallel for if(outer*len >= REDUCE_PARALLEL_MIN))
+            for(long o = 0; o < outer; o++){
+                const double *row = x + o*len;
+                double *yr = y + o*len;
+                const double l = lse[o];
+                if (l == ninf){
+                    for(long k = 0; k < len; k++) yr[k] = Exp ? 0.0 : ninf;
+                    continue;
+                }
+                REDUCE_OMP(omp simd)
+                for(long k = 0; k < len; k++) yr[k] = Exp ? std::exp(row[k] - l) : row[k] - l;
+            }
+            return;
+        }
+        REDUCE_OMP(omp parallel for if(outer*len*inner >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < outer; o++){
+            const double *l = lse + o*inner;
+            for(long k = 0; k < len; k++){
+                const long base = (o*len + k)*inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < inner; i++){
+                    const double d = l[i] == ninf ? ninf : x[base+i] - l[i];
+                    y[base+i] = Exp ? std::exp(d) : d;
+                }
+            }
+        }
+    }
+
+    // out[o,k,i] = scale * g[o,i]
+    static void broadcast_kernel(const double *g,double *out,const AxisSplit &s,double scale){
+        const long outer = s.outer, len = s.len, inner = s.inner;
+        REDUCE_OMP(omp parallel for if(outer*len*inner >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < outer; o++){
+            const double *go = g + o*inner;
+            for(long k = 0; k < len; k++){
+                double *slice = out + (o*len + k)*inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < inner; i++) slice[i] = scale*go[i];
+            }
+        }
+    }
+
+    static Tensor::Tensorptr reduce_with(const Tensor::Tensorptr &t,const AxisSplit &s,void (*kernel)(const double*,double*,const AxisSplit&)){
+        auto result = Tensor::CreateZeros(s.out_shape);
+        kernel(t->GetRawData(),result->GetRawData(),s);
+        return result;
+    }
+
+    static void check_grad_shape(const Tensor::Tensorptr &grad,const std::vector<int>&expected,const char *op){
+        if (grad->GetShape() != expected){
+            throw std::invalid_argument(std::string("grad shape doesn't match output of ") + op);
+        }
+    }
+
+    // ---- sum / mean ----
+
+    static Tensor::Tensorptr sum(const Tensor::Tensorptr &t){
+        return reduce_with(t,split_all(t->GetShape()),sum_kernel);
+    }
+    static Tensor::Tensorptr sum(const Tensor::Tensorptr &t,int axis){
+        return reduce_with(t,split_axis(t->GetShape(),axis),sum_kernel);
+    }
+    static Tensor::Tensorptr sum_backward(const Tensor::Tensorptr &grad,const std::vector<int>&input_shape){
+        auto s = split_all(input_shape);
+        check_grad_shape(grad,s.out_shape,"sum");
+        auto result = Tensor::CreateZeros(input_shape);
+        broadcast_kernel(grad->GetRawData(),result->GetRawData(),s,1.0);
+        return result;
+    }
+    static Tensor::Tensorptr sum_backward(const Tensor::Tensorptr &grad,const std::vector<int>&input_shape,int axis){
+        auto s = split_axis(input_shape,axis);
+        check_grad_shape(grad,s.out_shape,"sum");
+        auto result = Tensor::CreateZeros(input_shape);
+        broadcast_kernel(grad->GetRawData(),result->GetRawData(),s,1.0);
+        return result;
+    }
+
+    static Tensor::Tensorptr mean(const Tensor::Tensorptr &t){
+        auto s = split_all(t->GetShape());
+        auto result = reduce_with(t,s,sum_kernel);
+        result->GetRawData()[0] /= s.len;
+        return result;
+    }
+    static Tensor::Tensorptr mean(const Tensor::Tensorptr &t,int axis){
+        auto s = split_axis(t->GetShape(),axis);
+        auto result = reduce_with(t,s,sum_kernel);
+        double *r = result->GetRawData();
+        const double inv = 1.0/s.len;
+        for(int i = 0; i < result->GetTotalSize(); i++) r[i] *= inv;
+        return result;
+    }
+    static Tensor::Tensorptr mean_backward(const Tensor::Tensorptr &grad,const std::vector<int>&input_shape){
+        auto s = split_all(input_shape);
+        check_grad_shape(grad,s.out_shape,"mean");
+        auto result = Tensor::CreateZeros(input_shape);
+        broadcast_kernel(grad->GetRawData(),result->GetRawData(),s,1.0/s.len);
+        return result;
+    }
+    static Tensor::Tensorptr mean_backward(const Tensor::Tensorptr &grad,const std::vector<int>&input_shape,int axis){
+        auto s = split_axis(input_shape,axis);
+        check_grad_shape(grad,s.out_shape,"mean");
+        auto result = Tensor::CreateZeros(input_shape);
+        broadcast_kernel(grad->GetRawData(),result->GetRawData(),s,1.0/s.len);
+        return result;
+    }
+
+    // ---- max ----
+
+    static Tensor::Tensorptr max(const Tensor::Tensorptr &t){
+        return reduce_with(t,split_all(t->GetShape()),max_kernel);
+    }
+    static Tensor::Tensorptr max(const Tensor::Tensorptr &t,int axis){
+        return reduce_with(t,split_axis(t->GetShape(),axis),max_kernel);
+    }
+    // grad goes to the first element equal to the saved max along the axis. hit marks
+    // the slots already served so the scan can stay k outer, i inner and contiguous.
+    static Tensor::Tensorptr max_backward(const Tensor::Tensorptr &grad,const Tensor::Tensorptr &input,const Tensor::Tensorptr &output,const AxisSplit &s){
+        check_grad_shape(grad,s.out_shape,"max");
+        check_grad_shape(output,s.out_shape,"max");
+        auto result = Tensor::CreateZeros(input->GetShape());
+        const double *x = input->GetRawData();
+        const double *mx = output->GetRawData();
+        const double *g = grad->GetRawData();
+        double *dx = result->GetRawData();
+        if (s.inner == 1){
+            REDUCE_OMP(omp parallel for if(s.outer*s.len >= REDUCE_PARALLEL_MIN))
+            for(long o = 0; o < s.outer; o++){
+                const double *row = x + o*s.len;
+                for(long k = 0; k < s.len; k++){
+                    if (row[k] == mx[o]){ dx[o*s.len + k] = g[o]; break; }
+                }
+            }
+            return result;
+        }
+        std::vector<char> hits(s.outer*s.inner,0);
+        REDUCE_OMP(omp parallel for if(s.outer*s.len*s.inner >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < s.outer; o++){
+            const double *m = mx + o*s.inner;
+            const double *go = g + o*s.inner;
+            char *hit = hits.data() + o*s.inner;
+            for(long k = 0; k < s.len; k++){
+                const long base = (o*s.len + k)*s.inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < s.inner; i++){
+                    const char take = !hit[i] & (x[base+i] == m[i]);
+                    dx[base+i] = take ? go[i] : 0.0;
+                    hit[i] |= take;
+                }
+            }
+        }
+        return result;
+    }
+    static Tensor::Tensorptr max_backward(const Tensor::Tensorptr &grad,const Tensor::Tensorptr &input,const Tensor::Tensorptr &output){
+        return max_backward(grad,input,output,split_all(input->GetShape()));
+    }
+    static Tensor::Tensorptr max_backward(const Tensor::Tensorptr &grad,const Tensor::Tensorptr &input,const Tensor::Tensorptr &output,int axis){
+        return max_backward(grad,input,output,split_axis(input->GetShape(),axis));
+    }
+
+    // ---- logsumexp ----
+
+    static Tensor::Tensorptr logsumexp(const Tensor::Tensorptr &t){
+        return reduce_with(t,split_all(t->GetShape()),logsumexp_kernel);
+    }
+    static Tensor::Tensorptr logsumexp(const Tensor::Tensorptr &t,int axis){
+        return reduce_with(t,split_axis(t->GetShape(),axis),logsumexp_kernel);
+    }
+    // d lse / dx = exp(x - lse) = softmax(x), computed on the fly from the saved output
+    static Tensor::Tensorptr logsumexp_backward(const Tensor::Tensorptr &grad,const Tensor::Tensorptr &input,const Tensor::Tensorptr &output,const AxisSplit &s){
+        check_grad_shape(grad,s.out_shape,"logsumexp");
+        auto result = Tensor::CreateZeros(input->GetShape());
+        const double *x = input->GetRawData();
+        const double *lse = output->GetRawData();
+        const double *g = grad->GetRawData();
+        double *dx = result->GetRawData();
+        REDUCE_OMP(omp parallel for if(s.outer*s.len*s.inner >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < s.outer; o++){
+            const double *l = lse + o*s.inner;
+            const double *go = g + o*s.inner;
+            for(long k = 0; k < s.len; k++){
+                const long base = (o*s.len + k)*s.inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < s.inner; i++) dx[base+i] = go[i]*std::exp(x[base+i] - l[i]);
+            }
+        }
+        return result;
+    }
+    static Tensor::Tensorptr logsumexp_backward(const Tensor::Tensorptr &grad,const Tensor::Tensorptr &input,const Tensor::Tensorptr &output){
+        return logsumexp_backward(grad,input,output,split_all(input->GetShape()));
+    }
+    static Tensor::Tensorptr logsumexp_backward(const Tensor::Tensorptr &grad,const Tensor::Tensorptr &input,const Tensor::Tensorptr &output,int axis){
+        return logsumexp_backward(grad,input,output,split_axis(input->GetShape(),axis));
+    }
+
+    // ---- softmax / log_softmax ----
+
+    static Tensor::Tensorptr softmax(const Tensor::Tensorptr &t,int axis = -1){
+        auto s = split_axis(t->GetShape(),axis);
+        std::vector<double> lse(s.outer*s.inner);
+        logsumexp_kernel(t->GetRawData(),lse.data(),s);
+        auto result = Tensor::CreateZeros(t->GetShape());
+        softmax_kernel<true>(t->GetRawData(),lse.data(),result->GetRawData(),s);
+        return result;
+    }
+    static Tensor::Tensorptr log_softmax(const Tensor::Tensorptr &t,int axis = -1){
+        auto s = split_axis(t->GetShape(),axis);
+        std::vector<double> lse(s.outer*s.inner);
+        logsumexp_kernel(t->GetRawData(),lse.data(),s);
+        auto result = Tensor::CreateZeros(t->GetShape());
+        softmax_kernel<false>(t->GetRawData(),lse.data(),result->GetRawData(),s);
+        return result;
+    }
+
+    // dx = y * (g - sum_k g*y), the Jacobian is never built
+    static Tensor::Tensorptr softmax_backward(const Tensor::Tensorptr &grad,const Tensor::Tensorptr &output,int axis = -1){
+        if (grad->GetShape() != output->GetShape()){
+            throw std::invalid_argument("grad shape doesn't match output of softmax");
+        }
+        auto s = split_axis(output->GetShape(),axis);
+        auto result = Tensor::CreateZeros(output->GetShape());
+        const double *y = output->GetRawData();
+        const double *g = grad->GetRawData();
+        double *dx = result->GetRawData();
+        if (s.inner == 1){
+            REDUCE_OMP(omp parallel for if(s.outer*s.len >= REDUCE_PARALLEL_MIN))
+            for(long o = 0; o < s.outer; o++){
+                const double *yr = y + o*s.len;
+                const double *gr = g + o*s.len;
+                double *dr = dx + o*s.len;
+                double dot = 0.0;
+                REDUCE_OMP(omp simd reduction(+:dot))
+                for(long k = 0; k < s.len; k++) dot += gr[k]*yr[k];
+                REDUCE_OMP(omp simd)
+                for(long k = 0; k < s.len; k++) dr[k] = yr[k]*(gr[k] - dot);
+            }
+            return result;
+        }
+        std::vector<double> dots(s.outer*s.inner,0.0);
+        REDUCE_OMP(omp parallel for if(s.outer*s.len*s.inner >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < s.outer; o++){
+            double *dot = dots.data() + o*s.inner;
+            for(long k = 0; k < s.len; k++){
+                const long base = (o*s.len + k)*s.inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < s.inner; i++) dot[i] += g[base+i]*y[base+i];
+            }
+            for(long k = 0; k < s.len; k++){
+                const long base = (o*s.len + k)*s.inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < s.inner; i++) dx[base+i] = y[base+i]*(g[base+i] - dot[i]);
+            }
+        }
+        return result;
+    }
+
+    // dx = g - softmax * sum_k g, with softmax = exp(log_softmax output)
+    static Tensor::Tensorptr log_softmax_backward(const Tensor::Tensorptr &grad,const Tensor::Tensorptr &output,int axis = -1){
+        if (grad->GetShape() != output->GetShape()){
+            throw std::invalid_argument("grad shape doesn't match output of log_softmax");
+        }
+        auto s = split_axis(output->GetShape(),axis);
+        auto result = Tensor::CreateZeros(output->GetShape());
+        const double *ly = output->GetRawData();
+        const double *g = grad->GetRawData();
+        double *dx = result->GetRawData();
+        if (s.inner == 1){
+            REDUCE_OMP(omp parallel for if(s.outer*s.len >= REDUCE_PARALLEL_MIN))
+            for(long o = 0; o < s.outer; o++){
+                const double *lyr = ly + o*s.len;
+                const double *gr = g + o*s.len;
+                double *dr = dx + o*s.len;
+                double gsum = 0.0;
+                REDUCE_OMP(omp simd reduction(+:gsum))
+                for(long k = 0; k < s.len; k++) gsum += gr[k];
+                REDUCE_OMP(omp simd)
+                for(long k = 0; k < s.len; k++) dr[k] = gr[k] - std::exp(lyr[k])*gsum;
+            }
+            return result;
+        }
+        std::vector<double> gsums(s.outer*s.inner,0.0);
+        REDUCE_OMP(omp parallel for if(s.outer*s.len*s.inner >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < s.outer; o++){
+            double *gsum = gsums.data() + o*s.inner;
+            for(long k = 0; k < s.len; k++){
+                const long base = (o*s.len + k)*s.inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < s.inner; i++) gsum[i] += g[base+i];
+            }
+            for(long k = 0; k < s.len; k++){
+                const long base = (o*s.len + k)*s.inner;
+                REDUCE_OMP(omp simd)
+                for(long i = 0; i < s.inner; i++) dx[base+i] = g[base+i] - std::exp(ly[base+i])*gsum[i];
+            }
+        }
+        return result;
+    }
+
+    // ---- cross entropy ----
+
+    // logits are [..., C] with classes on the last axis, targets hold one class index per row.
+    // loss = mean over rows of (logsumexp(row) - row[target]), returned as a 0D tensor.
+    static AxisSplit cross_entropy_split(const Tensor::Tensorptr &logits,const std::vector<int>&targets){
+        if (logits->GetShape().empty()){
+            throw std::invalid_argument("cross_entropy needs logits with a class axis");
+        }
+        auto s = split_axis(logits->GetShape(),-1);
+        if ((long)targets.size() != s.outer){
+            throw std::invalid_argument("number of targets doesn't match rows of logits");
+        }
+        for(auto t : targets){
+            if (t < 0 || t >= s.len){
+                throw std::invalid_argument("target class out of range for cross_entropy");
+            }
+        }
+        return s;
+    }
+
+    static Tensor::Tensorptr cross_entropy(const Tensor::Tensorptr &logits,const std::vector<int>&targets){
+        auto s = cross_entropy_split(logits,targets);
+        std::vector<double> lse(s.outer);
+        const double *x = logits->GetRawData();
+        logsumexp_kernel(x,lse.data(),s);
+        double loss = 0.0;
+        REDUCE_OMP(omp parallel for reduction(+:loss) if(s.outer*s.len >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < s.outer; o++){
+            loss += lse[o] - x[o*s.len + targets[o]];
+        }
+        return Tensor::CreateScalar(loss/s.outer);
+    }
+
+    // dx = g/N * (softmax(row) - onehot(target)), softmax recomputed row by row
+    static Tensor::Tensorptr cross_entropy_backward(const Tensor::Tensorptr &grad,const Tensor::Tensorptr &logits,const std::vector<int>&targets){
+        auto s = cross_entropy_split(logits,targets);
+        check_grad_shape(grad,{},"cross_entropy");
+        std::vector<double> lse(s.outer);
+        const double *x = logits->GetRawData();
+        logsumexp_kernel(x,lse.data(),s);
+        auto result = Tensor::CreateZeros(logits->GetShape());
+        double *dx = result->GetRawData();
+        const double scale = grad->GetDataElem(0)/s.outer;
+        REDUCE_OMP(omp parallel for if(s.outer*s.len >= REDUCE_PARALLEL_MIN))
+        for(long o = 0; o < s.outer; o++){
+            const double *row = x + o*s.len;
+            double *drow = dx + o*s.len;
+            const double l = lse[o];
+            REDUCE_OMP(omp simd)
+            for(long k = 0; k < s.len; k++) drow[k] = scale*std::exp(row[k] - l);
+            drow[targets[o]] -= scale;
+        }
+        return result;
+    }
+}
+#endif // REDUCTION_H
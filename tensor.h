@@ -61,6 +61,7 @@ public:
     std::vector<int>GetShape(){return shape;}
     int GetTotalSize(){return data.size();}
     double GetDataElem(int i){return data[i];}
+    double *GetRawData(){return data.data();}
     void SetDataElem(int i,double val){data[i]=val;}
     double &operator()(int i){return data[i];}
     double &operator()(int i,int j){return data[i*stride[0] + j*stride[1]];}